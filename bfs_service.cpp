@@ -0,0 +1,168 @@
+#include "bfs_service.hpp"
+#include <bit>
+
+bfs_service::bfs_service(int n_threads, const digraph& g):
+  g(g),
+  workers(n_threads)
+{
+  for (int i = 0; i < n_threads; ++i) {
+    workers[i] = std::jthread(&bfs_service::worker, this);
+  }
+}
+
+bfs_service::~bfs_service() {
+  {
+    std::unique_lock lk(q.mutex);
+    q.stopping = true;
+    q.more.notify_all();
+  }
+  // Workers drain whatever is still queued before they exit.
+  workers.clear();
+}
+
+std::future<bfs_answer> bfs_service::submit(bfs_query query) {
+  assert(query.source >= 0 && query.source < g.num_verts());
+  assert(query.target >= -1 && query.target < g.num_verts());
+  assert(query.max_hops >= -1);
+  std::promise<bfs_answer> promise;
+  auto result = promise.get_future();
+  std::unique_lock lk(q.mutex);
+  q.queue.push({ query, std::move(promise) });
+  q.more.notify_one();
+  return result;
+}
+
+bool bfs_service::take_batch(std::vector<pending>& batch) {
+  std::unique_lock lk(q.mutex);
+  q.more.wait(lk, [&] { return !q.queue.empty() || q.stopping; });
+  if (q.queue.empty()) {
+    return false;
+  }
+  while (!q.queue.empty() && std::ssize(batch) < max_batch) {
+    batch.push_back(std::move(q.queue.front()));
+    q.queue.pop();
+  }
+  return true;
+}
+
+void bfs_service::run_batch(scratch& s, std::span<pending> batch) {
+  assert(std::ssize(batch) <= max_batch);
+  bfs_answer answers[max_batch] = {};
+  mask active = 0;
+
+  // Answers a query as soon as it stops, rather than when the whole
+  // batch does, so short queries are not held up by full traversals.
+  auto finish = [&](int i) {
+    active &= ~(mask(1) << i);
+    batch[i].promise.set_value(answers[i]);
+  };
+
+  auto mark_seen = [&](int vert, mask bits) {
+    if (!s.seen[vert]) {
+      s.touched.push_back(vert);
+    }
+    s.seen[vert] |= bits;
+  };
+
+  for (int i = 0; i < std::ssize(batch); ++i) {
+    const auto& query = batch[i].query;
+    const mask bit = mask(1) << i;
+    active |= bit;
+    answers[i].reached = 1;
+    if (query.target == query.source) {
+      answers[i].target_depth = 0;
+      finish(i);
+      continue;
+    }
+    if (query.max_hops == 0) {
+      finish(i);
+      continue;
+    }
+    mark_seen(query.source, bit);
+    if (!s.visit[query.source]) {
+      s.frontier.push_back(query.source);
+    }
+    s.visit[query.source] |= bit;
+  }
+
+  for (int depth = 1; active && !s.frontier.empty(); ++depth) {
+    mask grown = 0;
+    for (int src: s.frontier) {
+      if (!active) {
+        break;
+      }
+      // Skip the adjacency scan when every query that reached src has
+      // already stopped.
+      mask live = s.visit[src] & active;
+      if (!live) {
+        continue;
+      }
+      for (int dst: g.adj[src]) {
+        const mask fresh = live & ~s.seen[dst];
+        if (!fresh) {
+          continue;
+        }
+        mark_seen(dst, fresh);
+        if (!s.next[dst]) {
+          s.next_frontier.push_back(dst);
+        }
+        s.next[dst] |= fresh;
+        grown |= fresh;
+        for (mask m = fresh; m; m &= m - 1) {
+          int i = std::countr_zero(m);
+          ++answers[i].reached;
+          answers[i].max_depth = depth;
+          if (batch[i].query.target == dst) {
+            answers[i].target_depth = depth;
+            finish(i);
+            // A query that has just found its target must not keep
+            // counting vertices on this level.
+            live &= active;
+          }
+        }
+        if (!live) {
+          break;
+        }
+      }
+    }
+
+    // A query stops after the level at its hop limit, or once a level
+    // finds nothing new for it: everything reachable has been seen.
+    for (mask m = active; m; m &= m - 1) {
+      int i = std::countr_zero(m);
+      if (!(grown & (mask(1) << i)) || batch[i].query.max_hops == depth) {
+        finish(i);
+      }
+    }
+
+    for (int vert: s.frontier) {
+      s.visit[vert] = 0;
+    }
+    s.frontier.clear();
+    std::swap(s.visit, s.next);
+    std::swap(s.frontier, s.next_frontier);
+  }
+
+  for (int vert: s.frontier) {
+    s.visit[vert] = 0;
+  }
+  s.frontier.clear();
+  for (int vert: s.touched) {
+    s.seen[vert] = 0;
+  }
+  s.touched.clear();
+  // Every query has been answered: an empty frontier means that no
+  // query grew on the last level, and those were finished there.
+  assert(!active);
+}
+
+void bfs_service::worker() {
+  scratch s(g.num_verts());
+  std::vector<pending> batch;
+  batch.reserve(max_batch);
+  while (take_batch(batch)) {
+    ++n_batches;
+    run_batch(s, batch);
+    batch.clear();
+  }
+}
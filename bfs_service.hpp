@@ -0,0 +1,72 @@
+#pragma once
+#include "digraph.hpp"
+#include "huge_pages.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <span>
+#include <thread>
+#include <vector>
+
+struct bfs_query {
+  int source = 0;
+  int target = -1;   // stop as soon as this vertex is reached, -1 for none
+  int max_hops = -1; // do not go deeper than this, -1 for unlimited
+};
+
+struct bfs_answer {
+  int target_depth = -1; // -1 if there is no target or it was not reached
+  int reached = 0;       // vertices visited before the query stopped
+  int max_depth = 0;     // deepest level visited
+};
+
+// Answers concurrent BFS queries against one shared read-only graph.
+// Pending queries are taken by the workers in batches of up to 64, and
+// each batch is answered by a single multi-source traversal that keeps
+// one bit per query in every vertex's mask, so the adjacency lists are
+// scanned once per batch rather than once per query.
+struct bfs_service {
+  using mask = uint64_t;
+  constexpr static int max_batch = 64;
+
+  const digraph& g;
+
+  struct pending {
+    bfs_query query;
+    std::promise<bfs_answer> promise;
+  };
+
+  // Per-worker buffers, sized once and left all-zero between batches.
+  struct scratch {
+    std::vector<mask, huge_allocator<mask>> seen, visit, next;
+    std::vector<int> frontier, next_frontier, touched;
+
+    explicit scratch(int verts): seen(verts), visit(verts), next(verts) {}
+  };
+
+  struct {
+    std::mutex mutex;
+    std::condition_variable more;
+    std::queue<pending> queue;
+    bool stopping = false;
+  } q;
+
+  std::atomic<long> n_batches = 0;
+
+  std::vector<std::jthread> workers;
+
+  explicit bfs_service(int n_threads, const digraph& g);
+  ~bfs_service();
+
+  bfs_service(const bfs_service&) = delete;
+  bfs_service& operator=(const bfs_service&) = delete;
+
+  std::future<bfs_answer> submit(bfs_query query);
+
+  bool take_batch(std::vector<pending>& batch);
+  void run_batch(scratch& s, std::span<pending> batch);
+  void worker();
+};
@@ -1,11 +1,13 @@
 #pragma once
+#include "huge_pages.hpp"
 #include "svo.hpp"
 #include <cassert>
 #include <span>
 #include <vector>
 
 struct digraph {
-  std::vector<svo_vector<int>> adj;
+  using adj_list = svo_vector<int, arena_allocator<int>>;
+  std::vector<adj_list, huge_allocator<adj_list>> adj;
   int num_edges = 0;
 
   explicit digraph(int verts): adj(verts) {}
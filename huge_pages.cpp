@@ -0,0 +1,200 @@
+#include "huge_pages.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <linux/mman.h>
+#include <sys/mman.h>
+
+namespace {
+std::atomic<page_mode> requested = page_mode::system;
+
+// huge_free only knows the size, so remember what each mapping got.
+struct {
+  std::mutex mutex;
+  std::unordered_map<void*, page_mode> backing;
+  page_stats stats;
+} mappings;
+
+// Size classes of arena_alloc are powers of two from 8 bytes to 1 MB.
+// Free blocks are kept on intrusive singly linked lists, one per class.
+constexpr size_t arena_min_block = 8;
+constexpr size_t arena_max_block = size_t(1) << 20;
+constexpr size_t arena_chunk = size_t(64) << 20;
+constexpr int arena_classes = std::countr_zero(arena_max_block) + 1;
+
+struct {
+  std::mutex mutex;
+  void* free[arena_classes] = {};
+  char* bump = nullptr;
+  char* bump_end = nullptr;
+} arena;
+
+int arena_class(size_t bytes) {
+  return std::bit_width(std::max(bytes, arena_min_block) - 1);
+}
+
+size_t& stat_for(page_mode mode) {
+  switch (mode) {
+  case page_mode::system: return mappings.stats.system;
+  case page_mode::small: return mappings.stats.small;
+  case page_mode::thp: return mappings.stats.thp;
+  case page_mode::hugetlb: return mappings.stats.hugetlb;
+  }
+  std::unreachable();
+}
+
+size_t round_up(size_t bytes) {
+  return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+}
+
+// MAP_HUGE_2MB pins the size: plain MAP_HUGETLB takes the system default,
+// which may be 1 GB, and then lengths would not match huge_page_size.
+void* map_hugetlb(size_t bytes) {
+  void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+  return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+// Maps 2 MB-aligned memory so that every huge page of the range can be
+// backed by a PMD entry, not just the ones that happen to be aligned.
+void* map_aligned(size_t bytes) {
+  const size_t padded = bytes + huge_page_size;
+  void* raw = mmap(nullptr, padded, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return nullptr;
+  }
+  const auto begin = reinterpret_cast<uintptr_t>(raw);
+  const auto aligned = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+  if (aligned != begin) {
+    munmap(raw, aligned - begin);
+  }
+  const auto tail = begin + padded - (aligned + bytes);
+  if (tail) {
+    munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+  }
+  return reinterpret_cast<void*>(aligned);
+}
+} // namespace
+
+std::optional<page_mode> parse_page_mode(std::string_view name) {
+  for (auto mode: { page_mode::system, page_mode::small, page_mode::thp, page_mode::hugetlb }) {
+    if (name == page_mode_name(mode)) {
+      return mode;
+    }
+  }
+  return std::nullopt;
+}
+
+std::string_view page_mode_name(page_mode mode) {
+  switch (mode) {
+  case page_mode::system: return "system";
+  case page_mode::small: return "4k";
+  case page_mode::thp: return "thp";
+  case page_mode::hugetlb: return "hugetlb";
+  }
+  std::unreachable();
+}
+
+void set_page_mode(page_mode mode) {
+  requested = mode;
+}
+
+page_mode get_page_mode() {
+  return requested;
+}
+
+page_stats get_page_stats() {
+  std::unique_lock lk(mappings.mutex);
+  return mappings.stats;
+}
+
+std::optional<size_t> anon_huge_bytes() {
+  std::ifstream rollup("/proc/self/smaps_rollup");
+  std::string key;
+  size_t kb;
+  while (rollup >> key) {
+    if (key == "AnonHugePages:" && rollup >> kb) {
+      return kb * 1024;
+    }
+    rollup.ignore(SIZE_MAX, '\n');
+  }
+  return std::nullopt;
+}
+
+void* huge_alloc(size_t bytes) {
+  bytes = round_up(bytes);
+  const page_mode mode = requested;
+  page_mode obtained = page_mode::small;
+  void* ptr = nullptr;
+
+  if (mode == page_mode::hugetlb && (ptr = map_hugetlb(bytes))) {
+    obtained = page_mode::hugetlb;
+  } else if (!(ptr = map_aligned(bytes))) {
+    throw std::bad_alloc();
+  } else if (mode == page_mode::system) {
+    obtained = page_mode::system;
+  } else if (mode != page_mode::small && madvise(ptr, bytes, MADV_HUGEPAGE) == 0) {
+    obtained = page_mode::thp;
+  } else {
+    // Keep the 4k baseline honest when THP is set to "always".
+    madvise(ptr, bytes, MADV_NOHUGEPAGE);
+  }
+
+  std::unique_lock lk(mappings.mutex);
+  mappings.backing.emplace(ptr, obtained);
+  stat_for(obtained) += bytes;
+  return ptr;
+}
+
+void huge_free(void* ptr, size_t bytes) {
+  bytes = round_up(bytes);
+  {
+    std::unique_lock lk(mappings.mutex);
+    auto it = mappings.backing.find(ptr);
+    assert(it != mappings.backing.end());
+    stat_for(it->second) -= bytes;
+    mappings.backing.erase(it);
+  }
+  munmap(ptr, bytes);
+}
+
+void* arena_alloc(size_t bytes) {
+  if (bytes > arena_max_block) {
+    return huge_alloc(bytes);
+  }
+  const int cls = arena_class(bytes);
+  const size_t block = size_t(1) << cls;
+  std::unique_lock lk(arena.mutex);
+  if (void* ptr = arena.free[cls]) {
+    arena.free[cls] = *static_cast<void**>(ptr);
+    return ptr;
+  }
+  if (arena.bump_end - arena.bump < std::ptrdiff_t(block)) {
+    // The tail of the old chunk is abandoned; it is under 1 MB of 64.
+    arena.bump = static_cast<char*>(huge_alloc(arena_chunk));
+    arena.bump_end = arena.bump + arena_chunk;
+  }
+  void* ptr = arena.bump;
+  arena.bump += block;
+  return ptr;
+}
+
+void arena_free(void* ptr, size_t bytes) {
+  if (bytes > arena_max_block) {
+    huge_free(ptr, bytes);
+    return;
+  }
+  const int cls = arena_class(bytes);
+  std::unique_lock lk(arena.mutex);
+  *static_cast<void**>(ptr) = arena.free[cls];
+  arena.free[cls] = ptr;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+// Page backing for memory that is accessed at random (depths, the graph's
+// adjacency headers and edge lists). With 4 KB pages a 20M-vertex depths
+// array alone spans ~20k pages, far beyond what the dTLB can cover.
+enum class page_mode {
+  system,  // no madvise, whatever the system THP policy gives (default)
+  small,   // 4 KB pages, transparent huge pages explicitly disabled
+  thp,     // madvise(MADV_HUGEPAGE), falling back to 4 KB
+  hugetlb, // MAP_HUGETLB from the reserved pool, falling back to thp
+};
+
+std::optional<page_mode> parse_page_mode(std::string_view);
+std::string_view page_mode_name(page_mode);
+
+// Applies to allocations made after the call; existing ones keep their pages.
+void set_page_mode(page_mode);
+page_mode get_page_mode();
+
+// Bytes currently mapped by huge_alloc, by the backing actually obtained.
+struct page_stats {
+  size_t system = 0, small = 0, thp = 0, hugetlb = 0;
+};
+page_stats get_page_stats();
+
+// AnonHugePages of the whole process, from /proc/self/smaps_rollup,
+// i.e. how much of the thp backing the kernel has really populated.
+std::optional<size_t> anon_huge_bytes();
+
+constexpr size_t huge_page_size = size_t(2) << 20;
+
+void* huge_alloc(size_t bytes);
+void huge_free(void* ptr, size_t bytes);
+
+// Stateless allocator: requests of at least one huge page are mapped
+// directly with the backing selected by set_page_mode(), smaller ones
+// go to operator new as usual.
+template<typename T>
+struct huge_allocator {
+  using value_type = T;
+
+  huge_allocator() = default;
+  template<typename U>
+  huge_allocator(const huge_allocator<U>&) {}
+
+  T* allocate(size_t n) {
+    const size_t bytes = n * sizeof(T);
+    if (bytes < huge_page_size) {
+      return std::allocator<T>().allocate(n);
+    }
+    return static_cast<T*>(huge_alloc(bytes));
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    const size_t bytes = n * sizeof(T);
+    if (bytes < huge_page_size) {
+      std::allocator<T>().deallocate(ptr, n);
+    } else {
+      huge_free(ptr, bytes);
+    }
+  }
+
+  template<typename U>
+  bool operator==(const huge_allocator<U>&) const { return true; }
+};
+
+void* arena_alloc(size_t bytes);
+void arena_free(void* ptr, size_t bytes);
+
+// Stateless allocator for many small blocks, e.g. the adjacency lists
+// that spill out of svo_vector. Blocks are carved from huge_alloc'd
+// chunks in power-of-two size classes, so vector growth reuses the blocks
+// it frees. Chunks are kept for the lifetime of the process.
+template<typename T>
+struct arena_allocator {
+  using value_type = T;
+  static_assert(alignof(T) <= 8);
+
+  arena_allocator() = default;
+  template<typename U>
+  arena_allocator(const arena_allocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena_alloc(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    arena_free(ptr, n * sizeof(T));
+  }
+
+  template<typename U>
+  bool operator==(const arena_allocator<U>&) const { return true; }
+};
@@ -1,12 +1,19 @@
+#include "bfs_service.hpp"
 #include "digraph.hpp"
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
 #include <fmt/chrono.h>
 #include <fmt/color.h>
 #include <fmt/core.h>
 #include <fstream>
 #include <numeric>
+#include <string_view>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace {
 #if 1
@@ -86,9 +93,222 @@ struct timer {
     return std::chrono::duration_cast<dmilliseconds>(clock::now() - started);
   };
 };
+
+// Counts dTLB load misses of this thread and of threads it spawns,
+// from construction until measure(). Reads -1 where perf events are
+// unavailable. If the PMU had to multiplex the event, the count is
+// scaled up by the fraction of time it was actually running.
+struct tlb_counter {
+  int fd = -1;
+
+  tlb_counter() {
+    perf_event_attr attr {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+                | PERF_COUNT_HW_CACHE_OP_READ << 8
+                | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd != -1) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  ~tlb_counter() {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  tlb_counter(const tlb_counter&) = delete;
+  tlb_counter& operator=(const tlb_counter&) = delete;
+
+  long measure() const {
+    if (fd == -1) {
+      return -1;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    struct { uint64_t value, enabled, running; } r;
+    if (read(fd, &r, sizeof(r)) != sizeof(r) || r.running == 0) {
+      return -1;
+    }
+    return r.running < r.enabled ? long(double(r.value) * r.enabled / r.running) : long(r.value);
+  }
+};
+
+std::string describe_pages() {
+  auto stats = get_page_stats();
+  auto anon = anon_huge_bytes();
+  return fmt::format("pages ({} requested): system {}M, 4k {}M, thp {}M, hugetlb {}M, "
+                     "{}M populated as huge pages",
+    page_mode_name(get_page_mode()),
+    stats.system >> 20, stats.small >> 20, stats.thp >> 20, stats.hugetlb >> 20,
+    anon ? fmt::format("{}", *anon >> 20) : "?");
+}
+
+// The same figures as describe_pages(), as csv columns.
+constexpr std::string_view pages_csv_header =
+  "pages,mappedsystem,mapped4k,mappedthp,mappedhugetlb,anonhuge";
+
+std::string pages_csv_fields() {
+  auto stats = get_page_stats();
+  auto anon = anon_huge_bytes();
+  return fmt::format("{},{},{},{},{},{}",
+    page_mode_name(get_page_mode()),
+    stats.system, stats.small, stats.thp, stats.hugetlb,
+    anon ? long(*anon) : -1);
+}
+
+// Load generator for bfs_service: closed-loop clients, each waiting for
+// its previous answer before submitting the next query.
+// Usage: parbfs [system|4k|thp|hugetlb] queries [verts] [edges] [threads] [clients] [queries per client]
+int run_queries(int argc, char** argv) {
+  auto arg = [&](int i, int fallback) {
+    return argc > i ? std::atoi(argv[i]) : fallback;
+  };
+  const int v = arg(2, 2000'000);
+  const int e = arg(3, 10'000'000);
+  const int n_threads = arg(4, 4);
+  const int n_clients = arg(5, 64);
+  const int n_queries = arg(6, 100);
+
+  if (v < 2 || e < v-1 || e > long(v) * (v-1)
+      || n_threads < 1 || n_clients < 1 || n_queries < 1) {
+    fmt::print(stderr, "usage: parbfs [system|4k|thp|hugetlb] queries "
+      "[verts >= 2] [verts-1 <= edges <= verts*(verts-1)] "
+      "[threads >= 1] [clients >= 1] [queries per client >= 1]\n");
+    return 1;
+  }
+
+  rng rng;
+  digraph g = make_random_digraph(rng, v, e);
+  std::vector<int> depths(v);
+  bfs(g, depths);
+
+  bfs_service service(n_threads, g);
+
+  // A burst of queries from vertex 0, submitted without waiting so that
+  // they share batches, checked against the sequential depths.
+  bool equal = true;
+  {
+    std::uniform_int_distribution<int> vert(0, v-1);
+    std::uniform_int_distribution<int> hops(0, 5);
+    std::vector<std::pair<bfs_query, std::future<bfs_answer>>> burst;
+    for (int i = 0; i < 2 * bfs_service::max_batch; ++i) {
+      bfs_query query { .source = 0 };
+      if (i % 2 == 1) {
+        query.target = vert(rng);
+      }
+      if (i % 3 != 0) {
+        query.max_hops = hops(rng);
+      }
+      burst.emplace_back(query, service.submit(query));
+    }
+    for (auto& [query, future]: burst) {
+      auto answer = future.get();
+      auto within = [&](int d) {
+        return d != -1 && (query.max_hops == -1 || d <= query.max_hops);
+      };
+      if (query.target != -1) {
+        int d = depths[query.target];
+        equal &= answer.target_depth == (within(d) ? d : -1);
+      } else {
+        auto reached = std::ranges::count_if(depths, within);
+        int max_depth = 0;
+        for (int d: depths) {
+          if (within(d)) {
+            max_depth = std::max(max_depth, d);
+          }
+        }
+        equal &= answer.reached == reached && answer.max_depth == max_depth;
+      }
+    }
+  }
+  const long batches_before = service.n_batches;
+
+  std::vector<std::vector<double>> latencies(n_clients);
+  timer total_timer;
+  {
+    std::vector<std::jthread> clients;
+    for (int c = 0; c < n_clients; ++c) {
+      clients.emplace_back([&, c] {
+        xorshift128 client_rng(c + 1);
+        std::uniform_int_distribution<int> vert(0, v-1);
+        latencies[c].reserve(n_queries);
+        for (int i = 0; i < n_queries; ++i) {
+          // Mix of full traversals, point-to-point and hop-limited queries.
+          bfs_query query { .source = vert(client_rng) };
+          if (i % 2 == 1) {
+            query.target = vert(client_rng);
+          }
+          if (i % 4 >= 2) {
+            query.max_hops = 3;
+          }
+          timer query_timer;
+          service.submit(query).get();
+          latencies[c].push_back(query_timer.measure().count());
+        }
+      });
+    }
+  }
+  auto total_time = total_timer.measure();
+
+  std::vector<double> all;
+  for (auto& l: latencies) {
+    all.insert(all.end(), l.begin(), l.end());
+  }
+  std::ranges::sort(all);
+  auto percentile = [&](int p) {
+    return timer::dmilliseconds(all[std::min(std::ssize(all) - 1, std::ssize(all) * p / 100)]);
+  };
+  const long total = std::ssize(all);
+  const double qps = total / (total_time.count() / 1000);
+  const double avg_batch = double(total) / (service.n_batches - batches_before);
+
+  constexpr auto green = fg(fmt::color::green);
+  constexpr auto red = fg(fmt::color::red);
+  using namespace std::literals;
+
+  fmt::print(
+    "{}v / {}e\t{} queries ({} clients, {} threads): {:.0f} q/s\t"
+    "p50 {}\tp99 {}\tavg batch {:.1f}\tresult {}\n",
+    v, e, total, n_clients, n_threads, qps,
+    percentile(50), percentile(99), avg_batch,
+    equal ? styled("matches"sv, green) : styled("mismatch"sv, red));
+  fmt::print("\t{}\n", describe_pages());
+
+  std::ofstream csv("queries.csv");
+  csv << "v,e,threads,clients,queries,qps,p50,p99,avgbatch," << pages_csv_header << "\n";
+  csv << fmt::format("{},{},{},{},{},{},{},{},{},{}\n",
+    v, e, n_threads, n_clients, total, qps,
+    percentile(50).count(), percentile(99).count(), avg_batch, pages_csv_fields());
+  return equal ? 0 : 1;
+}
 } // namespace
 
-int main() {
+int main(int argc, char** argv) {
+  using namespace std::literals;
+  if (argc > 1) {
+    if (auto mode = parse_page_mode(argv[1])) {
+      set_page_mode(*mode);
+      --argc;
+      ++argv;
+    }
+  }
+  if (argc > 1 && argv[1] == "queries"sv) {
+    return run_queries(argc, argv);
+  }
+  if (argc > 1) {
+    fmt::print(stderr, "usage: parbfs [system|4k|thp|hugetlb] [queries ...]\n");
+    return 1;
+  }
+
   constexpr static struct { int v, e; } configs[] = {
     { 10, 50 },
     { 100, 500 },
@@ -103,12 +323,12 @@ int main() {
     { 20'000'000, 500'000'000 },
   };
 
-  std::vector<int> depths_seq(20'000'000);
-  std::vector<int> depths_par(20'000'000);
+  std::vector<int, huge_allocator<int>> depths_seq(20'000'000);
+  std::vector<int, huge_allocator<int>> depths_par(20'000'000);
   constexpr int n_threads = 4;
 
   std::ofstream csv("out.csv");
-  csv << "v,e,buildtime,seqtime,partime,threads\n";
+  csv << "v,e,buildtime,seqtime,partime,threads," << pages_csv_header << ",seqtlb,partlb\n";
 
   for (auto [v, e]: configs) {
     rng rng;
@@ -119,13 +339,17 @@ int main() {
     auto seq_span = std::span(depths_seq).subspan(0, v);
     auto par_span = std::span(depths_par).subspan(0, v);
 
+    tlb_counter seq_tlb;
     timer seq_timer;
     bfs(g, seq_span);
     auto seq_time = seq_timer.measure();
+    auto seq_misses = seq_tlb.measure();
 
+    tlb_counter par_tlb;
     timer par_timer;
     parallel_bfs(n_threads, g, par_span);
     auto par_time = par_timer.measure();
+    auto par_misses = par_tlb.measure();
 
     bool equal = std::ranges::equal(seq_span, par_span);
 
@@ -140,7 +364,10 @@ int main() {
       n_threads,
       styled(par_time, par_time < seq_time ? green : red),
       equal ? styled("matches"sv, green) : styled("mismatch"sv, red));
-    csv << fmt::format("{},{},{},{},{},{}\n",
-      v, e, build_time.count(), seq_time.count(), par_time.count(), n_threads);
+    fmt::print("\tdTLB load misses: seq {}, par {}\t{}\n",
+      seq_misses, par_misses, describe_pages());
+    csv << fmt::format("{},{},{},{},{},{},{},{},{}\n",
+      v, e, build_time.count(), seq_time.count(), par_time.count(), n_threads,
+      pages_csv_fields(), seq_misses, par_misses);
   }
 }
\ No newline at end of file
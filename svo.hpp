@@ -7,9 +7,9 @@
 // Non-feature-complete small vector. It is more compact than in boost.
 // It stores inline as many elements as will fit within the size
 // of std::vector, minus four bytes
-template<typename T>
+template<typename T, typename Alloc = std::allocator<T>>
 class svo_vector {
-  using large_vector = std::vector<T>;
+  using large_vector = std::vector<T, Alloc>;
   constexpr static size_t max_small
     = std::min(size_t(1), (sizeof(large_vector) - 4) / sizeof(T));
 